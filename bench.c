@@ -0,0 +1,293 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "includes/encrypt.h"
+
+#define BENCH_RECORDS 1000000
+#define BENCH_RECORD_SIZE 64
+#define BENCH_KEYS 16
+#define BENCH_HOT_RECORDS 1000
+#define CHECK_RECORDS 5000
+#define CHECK_MAX_SIZE 300
+
+/*
+ * Function:  encrypt_record
+ * --------------------
+ * This function encrypts one record with the same three stage
+ * loop that encrypt uses. It is the reference every batch code
+ * path is checked and timed against.
+ * --------------------
+ * ctx: key to encrypt with
+ * in: plaintext bytes
+ * out: ciphertext bytes
+ * len: number of bytes to encrypt
+ * offset: position of in[0] in the keystream
+ */
+void encrypt_record(struct key_context* ctx, unsigned char* in, unsigned char* out, long len, long offset) {
+    long i;
+    for(i = 0; i < len; ++i) {
+        //Stage 1: Sub each byte from the input text using the random sub table
+        out[i] = ctx->randomSub[in[i]];
+
+        //Stage 2: Shift bytes
+        out[i] = (out[i] << ctx->randomShift) | (out[i] >> (8 - ctx->randomShift));
+
+        //Stage 3: XOR with the cipher key
+        out[i] = out[i] ^ ctx->key[((offset + i) % 32)];
+    }
+}
+
+
+/*
+ * Function:  encrypt_record_setup
+ * --------------------
+ * This function encrypts one record the way a call to encrypt
+ * does, without the file reads and writes: a new key is made
+ * and a buffer is allocated for every record.
+ * --------------------
+ * in: plaintext bytes
+ * out: ciphertext bytes
+ * len: number of bytes to encrypt
+ */
+void encrypt_record_setup(unsigned char* in, unsigned char* out, long len) {
+    struct key_context ctx;
+
+    generate_key(&ctx.randomSub[0], &ctx.randomShift, &ctx.key[0]);
+
+    unsigned char* textArray = (unsigned char*)malloc(sizeof(*textArray) * len);
+    if(textArray == NULL) {
+        return;
+    }
+    memcpy(textArray, in, len);
+    encrypt_record(&ctx, textArray, out, len, 0);
+    free(textArray);
+}
+
+
+/*
+ * Function:  check_paths
+ * --------------------
+ * This function runs records of random length and keystream
+ * offset, spread over several keys, through every batch code
+ * path the CPU supports and compares them with encrypt_record.
+ * --------------------
+ * contexts: keys to use
+ *
+ * returns: 0 -> all paths match, 1-> a path does not match
+ */
+int check_paths(struct key_context* contexts) {
+    struct batch_record* records;
+    unsigned char *plaintext, *expected, *actual;
+    long total = (long)CHECK_RECORDS * CHECK_MAX_SIZE;
+    int path, i;
+
+    plaintext = (unsigned char*)malloc(sizeof(*plaintext) * total);
+    expected = (unsigned char*)malloc(sizeof(*expected) * total);
+    actual = (unsigned char*)malloc(sizeof(*actual) * total);
+    records = (struct batch_record*)malloc(sizeof(*records) * CHECK_RECORDS);
+    if(plaintext == NULL || expected == NULL || actual == NULL || records == NULL) {
+        fprintf(stderr, "malloc failed!\n");
+        return 1;
+    }
+
+    for(i = 0; i < total; ++i) {
+        plaintext[i] = (unsigned char)pcg32_boundedrand(CHAR_MAX);
+    }
+    for(i = 0; i < CHECK_RECORDS; ++i) {
+        records[i].ctx = &contexts[pcg32_boundedrand(BENCH_KEYS)];
+        records[i].in = plaintext + (long)i * CHECK_MAX_SIZE;
+        records[i].len = pcg32_boundedrand(CHECK_MAX_SIZE + 1);
+        records[i].offset = pcg32_boundedrand(1000);
+        encrypt_record(records[i].ctx, records[i].in, expected + (long)i * CHECK_MAX_SIZE,
+                       records[i].len, records[i].offset);
+    }
+
+    for(path = BATCH_SCALAR; path <= BATCH_AVX512; ++path) {
+        if(!batch_path_supported(path)) {
+            printf("Path %d: not supported on this CPU\n", path);
+            continue;
+        }
+
+        //Bytes past each record's length must be left alone
+        memset(actual, 0xa5, total);
+        for(i = 0; i < CHECK_RECORDS; ++i) {
+            records[i].out = actual + (long)i * CHECK_MAX_SIZE;
+        }
+        if(encrypt_batch_path(records, CHECK_RECORDS, path) == 1) {
+            return 1;
+        }
+
+        for(i = 0; i < CHECK_RECORDS; ++i) {
+            long start = (long)i * CHECK_MAX_SIZE;
+            long j;
+            if(memcmp(actual + start, expected + start, records[i].len) != 0) {
+                fprintf(stderr, "Path %d: record %d does not match encrypt!\n", path, i);
+                return 1;
+            }
+            for(j = records[i].len; j < CHECK_MAX_SIZE; ++j) {
+                if(actual[start + j] != 0xa5) {
+                    fprintf(stderr, "Path %d: record %d wrote past its end!\n", path, i);
+                    return 1;
+                }
+            }
+        }
+        printf("Path %d: matches encrypt\n", path);
+    }
+
+    free(plaintext);
+    free(expected);
+    free(actual);
+    free(records);
+    return 0;
+}
+
+
+/*
+ * Function:  time_paths
+ * --------------------
+ * This function times the per-record byte loop and every
+ * supported batch code path over the same records, repeated
+ * a number of times, and checks that they all agree.
+ * --------------------
+ * records: records to encrypt (out is used by the batch paths)
+ * count: number of records
+ * single: output buffer for the per-record loop
+ * batch: output buffer the records point into
+ * repeats: times to run over the records
+ * setupTime: time of the per-record run with setup, for reference
+ *
+ * returns: 0 -> function pass, 1-> function fail
+ */
+int time_paths(struct batch_record* records, int count, unsigned char* single, unsigned char* batch,
+               int repeats, double setupTime) {
+    long total = (long)count * BENCH_RECORD_SIZE;
+    double bytes = (double)total * repeats;
+    double singleTime, batchTime;
+    clock_t start;
+    int path, k;
+    long i;
+
+    //Each record on its own with a shared key, byte loop only
+    start = clock();
+    for(k = 0; k < repeats; ++k) {
+        for(i = 0; i < count; ++i) {
+            encrypt_record(records[i].ctx, records[i].in, single + i * BENCH_RECORD_SIZE, BENCH_RECORD_SIZE, 0);
+        }
+    }
+    singleTime = (double)(clock() - start) / CLOCKS_PER_SEC;
+    printf("Per-record byte loop:  %7.3f s (%8.1f MiB/s)\n", singleTime, bytes / singleTime / 1048576);
+
+    //All records in one batch, on every supported path
+    for(path = BATCH_SCALAR; path <= BATCH_AVX512; ++path) {
+        if(!batch_path_supported(path)) {
+            continue;
+        }
+
+        start = clock();
+        for(k = 0; k < repeats; ++k) {
+            if(encrypt_batch_path(records, count, path) == 1) {
+                return 1;
+            }
+        }
+        batchTime = (double)(clock() - start) / CLOCKS_PER_SEC;
+
+        if(memcmp(single, batch, total) != 0) {
+            fprintf(stderr, "Batch output does not match per-record output!\n");
+            return 1;
+        }
+
+        printf("Batch path %d:          %7.3f s (%8.1f MiB/s) %6.2fx vs byte loop", path, batchTime,
+               bytes / batchTime / 1048576, singleTime / batchTime);
+        if(setupTime > 0) {
+            printf(", %6.2fx vs setup", setupTime / batchTime);
+        }
+        printf("\n");
+    }
+    return 0;
+}
+
+
+/*
+ * Benchmark of encrypt_batch against per-record encryption on many
+ * small in-memory records. "./bench check" only runs the checks.
+ *
+ * The first run streams through 64MiB of records, so it is bound by
+ * memory bandwidth. The second keeps 64KiB of records in cache and
+ * runs over them many times, so it shows the cost of the byte work.
+ */
+int main(int argc, char* argv[]) {
+    struct key_context contexts[BENCH_KEYS];
+    struct batch_record* records;
+    unsigned char *plaintext, *single, *batch;
+    long total = (long)BENCH_RECORDS * BENCH_RECORD_SIZE;
+    clock_t start;
+    double setupTime;
+    long i;
+
+    //Keys shared by the records
+    for(i = 0; i < BENCH_KEYS; ++i) {
+        generate_key(&contexts[i].randomSub[0], &contexts[i].randomShift, &contexts[i].key[0]);
+        init_key_context(&contexts[i]);
+    }
+
+    if(check_paths(contexts) == 1) {
+        return 1;
+    }
+    if(argc == 2 && strcmp(argv[1], "check") == 0) {
+        return 0;
+    }
+
+    plaintext = (unsigned char*)malloc(sizeof(*plaintext) * total);
+    single = (unsigned char*)malloc(sizeof(*single) * total);
+    batch = (unsigned char*)malloc(sizeof(*batch) * total);
+    records = (struct batch_record*)malloc(sizeof(*records) * BENCH_RECORDS);
+    if(plaintext == NULL || single == NULL || batch == NULL || records == NULL) {
+        fprintf(stderr, "malloc failed!\n");
+        return 1;
+    }
+
+    for(i = 0; i < total; ++i) {
+        plaintext[i] = (unsigned char)pcg32_boundedrand(CHAR_MAX);
+    }
+
+    //Touch the output buffers so page faults are not timed
+    memset(single, 0, total);
+    memset(batch, 0, total);
+
+    for(i = 0; i < BENCH_RECORDS; ++i) {
+        records[i].ctx = &contexts[i % BENCH_KEYS];
+        records[i].in = plaintext + i * BENCH_RECORD_SIZE;
+        records[i].out = batch + i * BENCH_RECORD_SIZE;
+        records[i].len = BENCH_RECORD_SIZE;
+        records[i].offset = 0;
+    }
+
+    printf("Best path on this CPU: %d\n", best_batch_path());
+    printf("\n%d records of %d bytes, %d keys, streamed once\n", BENCH_RECORDS, BENCH_RECORD_SIZE, BENCH_KEYS);
+
+    //Each record as its own encrypt call: new key and buffer every time
+    start = clock();
+    for(i = 0; i < BENCH_RECORDS; ++i) {
+        encrypt_record_setup(records[i].in, single + i * BENCH_RECORD_SIZE, BENCH_RECORD_SIZE);
+    }
+    setupTime = (double)(clock() - start) / CLOCKS_PER_SEC;
+    printf("Per-record with setup: %7.3f s (%8.1f MiB/s)\n", setupTime, total / setupTime / 1048576);
+
+    if(time_paths(records, BENCH_RECORDS, single, batch, 1, setupTime) == 1) {
+        return 1;
+    }
+
+    printf("\n%d records of %d bytes, %d keys, in cache, run %d times\n", BENCH_HOT_RECORDS, BENCH_RECORD_SIZE,
+           BENCH_KEYS, BENCH_RECORDS / BENCH_HOT_RECORDS);
+    if(time_paths(records, BENCH_HOT_RECORDS, single, batch, BENCH_RECORDS / BENCH_HOT_RECORDS, 0) == 1) {
+        return 1;
+    }
+
+    free(plaintext);
+    free(single);
+    free(batch);
+    free(records);
+    return 0;
+}
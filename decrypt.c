@@ -70,11 +70,8 @@ int read_key(char* filename, unsigned char* invRandomSub, short* randomShift, un
  * to recover the plaintext from the ciphertext.
  * This algorithm is basically the reverse of the encryption.
  *
- * This function calls the read_key to read the key
- * structures from the cipherkey file.
- *
- * The decrypted file follows the naming convention
- * inputFilename_recovered.extension
+ * This function calls decrypt_to with an output file that
+ * follows the naming convention inputFilename_recovered.extension
  *
  * There are 3 stages when decryption:
  * 1) Use the 32-byte cipher key and XOR each set of 32 bytes
@@ -88,12 +85,35 @@ int read_key(char* filename, unsigned char* invRandomSub, short* randomShift, un
  * cipherkey: key file to the ciphertext
  */
 void decrypt(char* ciphertext, char* cipherkey) {
+    //Create name for the output recovered file
+    char* outFile = output_name(ciphertext, "_recovered");
+    if(outFile == NULL) {
+    	return;
+    }
+
+    decrypt_to(ciphertext, cipherkey, outFile);
+
+    //Free dynamically allocated memory for filename
+    free(outFile);
+}
+
+
+/*
+ * Function:  decrypt_to
+ * --------------------
+ * This function decrypts the ciphertext file into the given
+ * output file. It calls the read_key to read the key
+ * structures from the cipherkey file.
+ * --------------------
+ * ciphertext: file to decrypt
+ * cipherkey: key file to the ciphertext
+ * outFile: file to write the recovered text to
+ */
+void decrypt_to(char* ciphertext, char* cipherkey, char* outFile) {
     //Variables for file operations
     FILE *inFilePointer, *outFilePointer;
     long fileSize;
 
-	char* outFile;    //variable for file naming
-
     //Variables for sub table, random shift of bytes and key
     unsigned char invRandomSub[CHAR_MAX];
     short randomShift;
@@ -104,39 +124,12 @@ void decrypt(char* ciphertext, char* cipherkey) {
 		return;
 	}
  
-    //Open input ciphertext file
-    inFilePointer = fopen(ciphertext, "rb");
+    //Open input ciphertext file and get its size
+    inFilePointer = open_input(ciphertext, &fileSize);
     if(inFilePointer == NULL) {
-    	fprintf(stderr, "File open failed. Check if ciphertext file exists!\n");
-    	return;
-    }
-
-    //Get the size of file to encrypt
-    fseek(inFilePointer, 0, SEEK_END);
-    fileSize = ftell(inFilePointer);
-    fseek(inFilePointer, 0, SEEK_SET);
-    printf("File size: %ld bytes\n", fileSize);
-
-    if(fileSize == 0) {
-    	fprintf(stderr, "Invalid file size. Atleast one byte needed to encrypt!\n");
-    	fclose(inFilePointer);
     	return;
     }
 
-    //Allocate memory for output file name
-    outFile = (char*)malloc(sizeof(char) * (strlen(ciphertext) + 11));
-    if(outFile == NULL) {
-    	fprintf(stderr, "malloc failed!\n");
-    	return;
-    }
-
-    //Create name for the output recovered file
-    char* extensionPos = strrchr(ciphertext, '.');
-	int extensionIndex = strlen(ciphertext) - strlen(extensionPos);
-	strncpy(outFile, ciphertext, extensionIndex);
-	strcpy(outFile+extensionIndex, "_recovered");
-	strcpy(outFile+extensionIndex+10, extensionPos);
-
     //Open the output file
     outFilePointer = fopen(outFile, "wb");
     if(outFilePointer == NULL) {
@@ -144,9 +137,6 @@ void decrypt(char* ciphertext, char* cipherkey) {
     	return;
     }
 
-    //Free dynamically allocated memory for filename
-	free(outFile);
-
     //Process the file (at most 200MiB at once)
     while(fileSize > 0) {
     	//Find the size of block to decrypt
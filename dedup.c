@@ -0,0 +1,398 @@
+//realpath (XSI), getline, mkdir and friends are POSIX, not plain C
+#define _XOPEN_SOURCE 700
+
+#include <errno.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "encrypt.h"
+#include "decrypt.h"
+#include "dedup.h"
+
+/*
+ * Function:  hash_file
+ * --------------------
+ * This function reads a file once and computes the SHA-256
+ * digest of its contents. The digest names the file's copy
+ * in the dedup store.
+ * --------------------
+ * filename: file to hash
+ * digest: pointer to store the 32-byte digest
+ * fileSize: pointer to store the size of the file
+ *
+ * returns: 0 -> function pass, 1-> function fail
+ */
+int hash_file(char* filename, unsigned char* digest, long* fileSize) {
+    FILE* fp;    //file pointer
+    struct sha256_context hash;
+    size_t readSize;
+    long total = 0;
+
+    fp = fopen(filename, "rb");
+    if(fp == NULL) {
+        fprintf(stderr, "File open failed. Check if %s exists!\n", filename);
+        return 1;
+    }
+
+    unsigned char* buffer = (unsigned char*)malloc(sizeof(*buffer) * HASH_BUF_SIZE);
+    if(buffer == NULL) {
+        fprintf(stderr, "malloc failed!\n");
+        fclose(fp);
+        return 1;
+    }
+
+    //Hash the file a block at a time
+    sha256_init(&hash);
+    while((readSize = fread(buffer, sizeof(*buffer), HASH_BUF_SIZE, fp)) > 0) {
+        sha256_update(&hash, buffer, readSize);
+        total += readSize;
+    }
+
+    if(ferror(fp)) {
+        fprintf(stderr, "fread failed while trying to hash the plaintext.\n");
+        free(buffer);
+        fclose(fp);
+        return 1;
+    }
+
+    free(buffer);
+    fclose(fp);
+
+    sha256_final(&hash, digest);
+    *fileSize = total;
+    return 0;
+}
+
+
+/*
+ * Function:  open_store
+ * --------------------
+ * This function makes sure the dedup store directory exists,
+ * creating it if needed, and returns its absolute path so the
+ * names recorded in cipherref files work from any directory.
+ *
+ * The returned string is allocated on the heap and must be
+ * freed by the caller.
+ * --------------------
+ * storeDir: dedup store directory
+ *
+ * returns: absolute path of the store, NULL on failure
+ */
+char* open_store(char* storeDir) {
+    if(mkdir(storeDir, 0700) != 0 && !file_exists(storeDir)) {
+        fprintf(stderr, "Could not create the dedup store %s.\n", storeDir);
+        return NULL;
+    }
+
+    char* store = realpath(storeDir, NULL);
+    if(store == NULL) {
+        fprintf(stderr, "Could not resolve the dedup store %s.\n", storeDir);
+    }
+    return store;
+}
+
+
+/*
+ * Function:  store_name
+ * --------------------
+ * This function builds the name of an entry in the dedup store.
+ * Each entry is a directory named by the hex digest of the
+ * plaintext it holds, with the files store/digest/ciphertext and
+ * store/digest/cipherkey, so an entry only ever holds one content.
+ *
+ * The returned string is allocated on the heap and must be
+ * freed by the caller.
+ * --------------------
+ * store: absolute path of the dedup store
+ * digest: SHA-256 digest of the plaintext
+ * suffix: suffix to add, e.g. "/ciphertext"
+ *
+ * returns: new file name, NULL on failure
+ */
+char* store_name(char* store, unsigned char* digest, char* suffix) {
+    int i;
+    size_t length = strlen(store) + 1 + 2 * SHA256_SIZE + strlen(suffix) + 1;
+
+    char* name = (char*)malloc(sizeof(char) * length);
+    if(name == NULL) {
+        fprintf(stderr, "malloc failed!\n");
+        return NULL;
+    }
+
+    char* pos = name + sprintf(name, "%s/", store);
+    for(i = 0; i < SHA256_SIZE; ++i) {
+        pos += sprintf(pos, "%02x", digest[i]);
+    }
+    strcpy(pos, suffix);
+
+    return name;
+}
+
+
+/*
+ * Function:  file_exists
+ * --------------------
+ * This function checks whether a file or directory exists.
+ * --------------------
+ * filename: path to check
+ *
+ * returns: 1 -> exists, 0-> does not exist
+ */
+int file_exists(char* filename) {
+    struct stat info;
+    return stat(filename, &info) == 0;
+}
+
+
+/*
+ * Function:  store_file
+ * --------------------
+ * This function makes sure the dedup store holds an encrypted
+ * copy of the input file.
+ *
+ * If the store already has an entry for this digest, nothing is
+ * written. Otherwise the file is encrypted into a temporary entry
+ * directory while its contents are hashed again. The entry is only
+ * published if the second digest matches, so a file that changes
+ * while it is being stored is never recorded under the wrong digest.
+ *
+ * The ciphertext and cipherkey are published together by renaming
+ * the temporary directory. rename never replaces a directory that
+ * is not empty, so if another run stored the same contents first,
+ * its entry is kept and this copy is thrown away.
+ * --------------------
+ * store: absolute path of the dedup store
+ * inputFile: file to store
+ * digest: SHA-256 digest of the file from hash_file
+ *
+ * returns: 0 -> function pass, 1-> function fail
+ */
+int store_file(char* store, char* inputFile, unsigned char* digest) {
+    struct sha256_context hash;
+    unsigned char checkDigest[SHA256_SIZE];
+    int result = 1;
+
+    char* entry = store_name(store, digest, "");
+    char* ciphertext = store_name(store, digest, "/ciphertext");
+    char* cipherkey = store_name(store, digest, "/cipherkey");
+    char* tmpEntry = (entry == NULL) ? NULL : (char*)malloc(sizeof(char) * (strlen(entry) + 32));
+    char* tmpText = (entry == NULL) ? NULL : (char*)malloc(sizeof(char) * (strlen(entry) + 48));
+    char* tmpKey = (entry == NULL) ? NULL : (char*)malloc(sizeof(char) * (strlen(entry) + 48));
+
+    if(ciphertext == NULL || cipherkey == NULL || tmpEntry == NULL || tmpText == NULL || tmpKey == NULL) {
+        fprintf(stderr, "malloc failed!\n");
+    } else if(file_exists(entry)) {
+        //Same contents already stored
+        if(file_exists(ciphertext) && file_exists(cipherkey)) {
+            printf("Duplicate, already stored\n");
+            result = 0;
+        } else {
+            fprintf(stderr, "Dedup store entry %s is incomplete. Remove it and try again!\n", entry);
+        }
+    } else {
+        //Encrypt into a temporary entry, digesting what is actually read
+        sprintf(tmpEntry, "%s.%ld.tmp", entry, (long)getpid());
+        sprintf(tmpText, "%s/ciphertext", tmpEntry);
+        sprintf(tmpKey, "%s/cipherkey", tmpEntry);
+
+        if(mkdir(tmpEntry, 0700) != 0) {
+            fprintf(stderr, "Could not create %s in the dedup store.\n", tmpEntry);
+        } else {
+            int published = 0;
+
+            sha256_init(&hash);
+            result = encrypt_to(inputFile, tmpText, tmpKey, &hash);
+
+            if(result == 0) {
+                sha256_final(&hash, checkDigest);
+                if(memcmp(digest, checkDigest, SHA256_SIZE) != 0) {
+                    fprintf(stderr, "%s changed while it was being stored. Try again!\n", inputFile);
+                    result = 1;
+                }
+            }
+
+            //Publish the ciphertext and cipherkey in one step
+            if(result == 0) {
+                if(rename(tmpEntry, entry) == 0) {
+                    printf("Stored new contents\n");
+                    published = 1;
+                } else if((errno == EEXIST || errno == ENOTEMPTY) && file_exists(ciphertext) && file_exists(cipherkey)) {
+                    printf("Duplicate, stored by another run\n");
+                } else {
+                    fprintf(stderr, "rename failed while trying to add %s to the dedup store.\n", inputFile);
+                    result = 1;
+                }
+            }
+
+            if(!published) {
+                remove(tmpText);
+                remove(tmpKey);
+                rmdir(tmpEntry);
+            }
+        }
+    }
+
+    free(entry);
+    free(ciphertext);
+    free(cipherkey);
+    free(tmpEntry);
+    free(tmpText);
+    free(tmpKey);
+    return result;
+}
+
+
+/*
+ * Function:  write_ref
+ * --------------------
+ * This function records where the encrypted copy of a file is
+ * kept by writing a cipherref file next to it.
+ *
+ * The cipherref file holds the absolute names of the ciphertext
+ * and the cipherkey in the dedup store, one per line, and can be
+ * decrypted with decrypt_ref. It follows the naming convention
+ * inputFilename_cipherref.extension
+ * --------------------
+ * inputFile: plaintext file
+ * ciphertext: ciphertext file in the store
+ * cipherkey: cipherkey file in the store
+ *
+ * returns: 0 -> function pass, 1-> function fail
+ */
+int write_ref(char* inputFile, char* ciphertext, char* cipherkey) {
+    FILE* fp;    //file pointer
+
+    char* refFile = output_name(inputFile, "_cipherref");
+    if(refFile == NULL) {
+        return 1;
+    }
+
+    fp = fopen(refFile, "w");
+    free(refFile);
+    if(fp == NULL) {
+        fprintf(stderr, "File open failed while trying to write the cipherref.\n");
+        return 1;
+    }
+
+    if(fprintf(fp, "%s\n%s\n", ciphertext, cipherkey) < 0) {
+        fprintf(stderr, "fprintf failed while trying to write the cipherref.\n");
+        fclose(fp);
+        return 1;
+    }
+
+    if(fclose(fp) != 0) {
+        fprintf(stderr, "fclose failed while trying to write the cipherref.\n");
+        return 1;
+    }
+    return 0;
+}
+
+
+/*
+ * Function:  encrypt_dedup
+ * --------------------
+ * This function encrypts files through a content-addressed dedup
+ * store so that files with identical contents are only encrypted
+ * and stored once.
+ *
+ * Each plaintext is hashed in a single pass. The digest names
+ * its entry in the store, so looking up a file
+ * only needs the store directory and never scans an index. Every
+ * input file gets a cipherref file pointing into the store.
+ * --------------------
+ * storeDir: dedup store directory
+ * inputFiles: files to encrypt
+ * count: number of files
+ */
+void encrypt_dedup(char* storeDir, char** inputFiles, int count) {
+    unsigned char digest[SHA256_SIZE];
+    long fileSize;
+    int i;
+
+    char* store = open_store(storeDir);
+    if(store == NULL) {
+        return;
+    }
+
+    if(strchr(store, '\n') != NULL) {
+        fprintf(stderr, "Dedup store path can not contain a newline.\n");
+        free(store);
+        return;
+    }
+
+    for(i = 0; i < count; ++i) {
+        printf("%s\n", inputFiles[i]);
+
+        if(hash_file(inputFiles[i], &digest[0], &fileSize) == 1) {
+            continue;
+        }
+
+        if(fileSize == 0) {
+            fprintf(stderr, "Invalid file size. Atleast one byte needed to encrypt!\n");
+            continue;
+        }
+
+        if(store_file(store, inputFiles[i], &digest[0]) == 1) {
+            continue;
+        }
+
+        //Point the input file at its copy in the store
+        char* ciphertext = store_name(store, &digest[0], "/ciphertext");
+        char* cipherkey = store_name(store, &digest[0], "/cipherkey");
+        if(ciphertext != NULL && cipherkey != NULL) {
+            write_ref(inputFiles[i], ciphertext, cipherkey);
+        }
+        free(ciphertext);
+        free(cipherkey);
+    }
+
+    free(store);
+}
+
+
+/*
+ * Function:  decrypt_ref
+ * --------------------
+ * This function decrypts the file a cipherref points to.
+ *
+ * The recovered file follows the naming convention
+ * refFilename_recovered.extension
+ * --------------------
+ * refFile: cipherref file written by encrypt_dedup
+ */
+void decrypt_ref(char* refFile) {
+    FILE* fp;    //file pointer
+    char* ciphertext = NULL;
+    char* cipherkey = NULL;
+    size_t textSize = 0, keySize = 0;
+    ssize_t textLength, keyLength;
+
+    fp = fopen(refFile, "r");
+    if(fp == NULL) {
+        fprintf(stderr, "File open failed. Check if cipherref file exists!\n");
+        return;
+    }
+
+    //One file name per line
+    textLength = getline(&ciphertext, &textSize, fp);
+    keyLength = getline(&cipherkey, &keySize, fp);
+    fclose(fp);
+
+    if(textLength <= 1 || keyLength <= 1 || ciphertext[textLength-1] != '\n' || cipherkey[keyLength-1] != '\n') {
+        fprintf(stderr, "Invalid cipherref file. Make sure its the correct file!\n");
+        free(ciphertext);
+        free(cipherkey);
+        return;
+    }
+    ciphertext[textLength-1] = '\0';
+    cipherkey[keyLength-1] = '\0';
+
+    char* outFile = output_name(refFile, "_recovered");
+    if(outFile != NULL) {
+        decrypt_to(ciphertext, cipherkey, outFile);
+    }
+
+    free(outFile);
+    free(ciphertext);
+    free(cipherkey);
+}
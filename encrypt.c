@@ -1,5 +1,10 @@
 #include "encrypt.h"
 
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#include <immintrin.h>
+#define BATCH_X86 1
+#endif
+
 /*
  * Function:  shuffle
  * --------------------
@@ -42,8 +47,14 @@ void shuffle(unsigned char* array, int n) {
 void generate_key(unsigned char* randomSub, short* randomShift, unsigned char* key) {
     int i;
 
-	//Random seed function for pcg library - uses time and virtual addresses
-    pcg32_srandom(time(NULL) ^ (intptr_t)&printf, (intptr_t)&i);
+    static int seeded = 0;
+
+	//Random seed function for pcg library - uses time and virtual addresses.
+	//Only seeded once so repeated calls in one run give different keys
+    if(!seeded) {
+        pcg32_srandom(time(NULL) ^ (intptr_t)&printf, (intptr_t)&i);
+        seeded = 1;
+    }
 
     //Generate the byte substitution table
     for(i = 0; i < CHAR_MAX; ++i) {
@@ -67,62 +78,52 @@ void generate_key(unsigned char* randomSub, short* randomShift, unsigned char* k
  * This function takes in the parts of the cipher key, namely
  * the random substitution table, the random shift and the
  * key, and writes it out to a cipherkey file.
- *
- * The output file uses the name of the input file  and follows
- * the naming convention inputFilename_cipherkey.extension
  * --------------------
- * filename: input file used for encryption
+ * keyFile: cipherkey file to write
  * randomSub: random substitution table (as an array of unsigned char)
  * randomShift: cyclical byte shift
  * key: 32 byte key used to XOR
+ *
+ * returns: 0 -> function pass, 1-> function fail
  */
-void write_key(char* filename, unsigned char* randomSub, short* randomShift, unsigned char* key) {
-    char* outFile;    //varibale for file naming
+int write_key(char* keyFile, unsigned char* randomSub, short* randomShift, unsigned char* key) {
     FILE* fp;    //file pointer
 
-    outFile = (char*)malloc(sizeof(*filename) * (strlen(filename) + 11));
-    if(outFile == NULL) {
-    	fprintf(stderr, "malloc failed!\n");
-    	return;
-    }
-
-    //Create name for cipherkey file
-    char* extensionPos = strrchr(filename, '.');
-    int extensionIndex = strlen(filename) - strlen(extensionPos);
-    strncpy(outFile, filename, extensionIndex);
-    strcpy(outFile+extensionIndex, "_cipherkey");
-    strcpy(outFile+extensionIndex+10, extensionPos);
-
     //Open cipherkey file for writing
-    fp = fopen(outFile, "wb");
+    fp = fopen(keyFile, "wb");
     if(fp == NULL) {
     	fprintf(stderr, "File open failed while trying to write the cipherkey.\n");
-    	return;
+    	return 1;
     }
 
-    //Free memory allocated for filename
-    free(outFile);
-
     //Write the sub table to the cipherkey file
     if(fwrite(randomSub, sizeof(unsigned char), CHAR_MAX, fp) != CHAR_MAX) {
     	fprintf(stderr, "fwrite failed while trying to write the sub table.\n");
-    	return;
+    	fclose(fp);
+    	return 1;
     }
 
     //Write the random shift to the cipherkey file
     if(fwrite(randomShift, sizeof(short), 1, fp) != 1) {
     	fprintf(stderr, "fwrite failed while trying to write the shift.\n");
-    	return;
+    	fclose(fp);
+    	return 1;
     }
 
     //Write the key to the cipherkey file
     if(fwrite(key, sizeof(unsigned char), KEY_SIZE, fp) != KEY_SIZE) {
     	fprintf(stderr, "fwrite failed while trying to write the key.\n");
-    	return;
+    	fclose(fp);
+    	return 1;
+    }
+
+    //Close file, buffered writes can still fail here
+    if(fclose(fp) != 0) {
+    	fprintf(stderr, "fclose failed while trying to write the cipherkey.\n");
+    	return 1;
     }
 
-    //Close file
-    fclose(fp);
+    return 0;
 }
 
 
@@ -134,12 +135,9 @@ void write_key(char* filename, unsigned char* randomSub, short* randomShift, uns
  * This algorithm is basically a substitution cipher (a hybrid
  * stream/block cipher) that can handle a file of any size.
  *
- * This function calls the generate_key to generate the key
- * structures and write_key function to write the cipher key
- * to a file.
- *
- * The encrypted file follows the naming convention
- * inputFilename_ciphertext.extension
+ * This function calls encrypt_to with output files that follow
+ * the naming convention inputFilename_ciphertext.extension and
+ * inputFilename_cipherkey.extension
  *
  * There are 3 stages when encrypting:
  * 1) Generate a random substitute table and sub each 8-bit
@@ -150,13 +148,52 @@ void write_key(char* filename, unsigned char* randomSub, short* randomShift, uns
  * from the incoming file with this key for added confusion.
  * --------------------
  * inputFile: file to encrypt
+ *
+ * returns: 0 -> function pass, 1-> function fail
  */
-void encrypt(char* inputFile) {
+int encrypt(char* inputFile) {
+    int result = 1;
+
+    //Create names for the output ciphertext and cipherkey files
+    char* outFile = output_name(inputFile, "_ciphertext");
+    char* keyFile = output_name(inputFile, "_cipherkey");
+
+    if(outFile != NULL && keyFile != NULL) {
+        result = encrypt_to(inputFile, outFile, keyFile, NULL);
+    }
+
+    //Free heap allocated for output filenames
+    free(outFile);
+    free(keyFile);
+    return result;
+}
+
+
+/*
+ * Function:  encrypt_to
+ * --------------------
+ * This function generates a new key, encrypts the input file
+ * into the given ciphertext file and writes the key to the
+ * given cipherkey file.
+ *
+ * This function calls the generate_key to generate the key
+ * structures and write_key function to write the cipher key
+ * to a file. If a digest is given, the plaintext is added to
+ * it block by block as it is encrypted, so the caller knows
+ * exactly which bytes the ciphertext holds.
+ * --------------------
+ * inputFile: file to encrypt
+ * outFile: ciphertext file to write
+ * keyFile: cipherkey file to write
+ * hash: SHA-256 digest to add the plaintext to (may be NULL)
+ *
+ * returns: 0 -> function pass, 1-> function fail
+ */
+int encrypt_to(char* inputFile, char* outFile, char* keyFile, struct sha256_context* hash) {
     //Variables for file operations
     FILE *inFilePointer, *outFilePointer;
     long fileSize;
-
-    char* outFile;    //variable for file naming
+    int result = 0;
 
     //Variables for random sub table, random shift of bytes and key
     unsigned char randomSub[CHAR_MAX];
@@ -166,51 +203,22 @@ void encrypt(char* inputFile) {
     //Generate the key structures
     generate_key(&randomSub[0], &randomShift, &key[0]);
 
-    //Open input file
-    inFilePointer = fopen(inputFile, "rb");
+    //Open input file and get the size of file to encrypt
+    inFilePointer = open_input(inputFile, &fileSize);
     if(inFilePointer == NULL) {
-    	fprintf(stderr, "File open failed. Check if input file exists!\n");
-    	return;
-    }
-
-    //Get the size of file to encrypt
-    fseek(inFilePointer, 0, SEEK_END);
-    fileSize = ftell(inFilePointer);
-    fseek(inFilePointer, 0, SEEK_SET);
-    printf("File size: %ld bytes\n", fileSize);
-
-    if(fileSize == 0) {
-    	fprintf(stderr, "Invalid file size. Atleast one byte needed to encrypt!\n");
-    	fclose(inFilePointer);
-    	return;
-    }
-
-    //Memory for output filename
-    outFile = (char*)malloc(sizeof(char) * (strlen(inputFile) + 12));
-    if(outFile == NULL) {
-    	fprintf(stderr, "malloc failed!\n");
-    	return;
+    	return 1;
     }
 
-    //Create name for the output ciphertext file
-    char* extensionPos = strrchr(inputFile, '.');
-    int extensionIndex = strlen(inputFile) - strlen(extensionPos);
-    strncpy(outFile, inputFile, extensionIndex);
-    strcpy(outFile+extensionIndex, "_ciphertext");
-    strcpy(outFile+extensionIndex+11, extensionPos);
-
     //Open the output file
     outFilePointer = fopen(outFile, "wb");
     if(outFilePointer == NULL) {
     	fprintf(stderr, "File open failed while trying to write the ciphertext.\n");
-    	return;
+    	fclose(inFilePointer);
+    	return 1;
     }
 
-    //Free heap allocated for output filename
-    free(outFile);
-    
     //Process the file (at most 200MiB at once)
-    while(fileSize > 0) {
+    while(fileSize > 0 && result == 0) {
     	//Find the size of block to encrypt
     	int allocSize = (fileSize > MAX_BUF_SIZE) ? MAX_BUF_SIZE : fileSize;
 
@@ -218,13 +226,21 @@ void encrypt(char* inputFile) {
     	unsigned char* textArray = (unsigned char*)malloc(sizeof(*textArray) * allocSize);
         if(textArray == NULL) {
             fprintf(stderr, "malloc failed!\n");
-            return;
+            result = 1;
+            break;
         }
 
         //Read the input from the file
         if(fread(textArray, sizeof(*textArray), allocSize, inFilePointer) != allocSize) {
             fprintf(stderr, "fread failed while trying to read the plaintext.\n");
-            return;
+            free(textArray);
+            result = 1;
+            break;
+        }
+
+        //Digest the plaintext exactly as it was read
+        if(hash != NULL) {
+            sha256_update(hash, textArray, allocSize);
         }
 
         int i;
@@ -242,7 +258,7 @@ void encrypt(char* inputFile) {
         //Write the ciphertext block to output the file
         if(fwrite(textArray, sizeof(*textArray), allocSize, outFilePointer) != allocSize) {
             fprintf(stderr, "fwrite failed while trying to write the ciphertext.\n");
-            return;
+            result = 1;
         }
 
         //Free heap memory
@@ -253,8 +269,322 @@ void encrypt(char* inputFile) {
 
     //Close files
     fclose(inFilePointer);
-    fclose(outFilePointer);
+    if(fclose(outFilePointer) != 0 && result == 0) {
+        fprintf(stderr, "fclose failed while trying to write the ciphertext.\n");
+        result = 1;
+    }
+
+    if(result == 1) {
+        return 1;
+    }
 
     //Write key to file
-    write_key(inputFile, &randomSub[0], &randomShift, &key[0]);
+    return write_key(keyFile, &randomSub[0], &randomShift, &key[0]);
+}
+
+
+/*
+ * Function:  init_key_context
+ * --------------------
+ * This function fills in the fused substitution table and the
+ * keystream of a key context from its random sub table, random
+ * shift and key.
+ *
+ * Stages 1 and 2 of the encryption only depend on the value of
+ * the byte, so they are combined into a single table lookup.
+ * The key is stored three times in a row so the keystream for
+ * any offset can be read as one run of up to 64 bytes.
+ * --------------------
+ * ctx: key context with randomSub, randomShift and key already set
+ */
+void init_key_context(struct key_context* ctx) {
+    int i;
+    for(i = 0; i < CHAR_MAX; ++i) {
+        unsigned char sub = ctx->randomSub[i];
+        ctx->subShift[i] = (sub << ctx->randomShift) | (sub >> (8 - ctx->randomShift));
+    }
+    for(i = 0; i < 3 * KEY_SIZE; ++i) {
+        ctx->keyStream[i] = ctx->key[i % KEY_SIZE];
+    }
+}
+
+
+/*
+ * Function:  encrypt_run_scalar
+ * --------------------
+ * This function encrypts a run of records that share one key,
+ * one byte at a time. It is used when no vector path is available.
+ * --------------------
+ * records: array of all records in the batch
+ * start: index of the run's first record
+ * end: index one past the run's last record
+ */
+static void encrypt_run_scalar(struct batch_record* records, int start, int end) {
+    struct key_context* ctx = records[start].ctx;
+    unsigned char* table = ctx->subShift;
+    int r;
+
+    for(r = start; r < end; ++r) {
+        unsigned char* in = records[r].in;
+        unsigned char* out = records[r].out;
+        unsigned char* stream = ctx->keyStream + records[r].offset % KEY_SIZE;
+        long i;
+
+        for(i = 0; i < records[r].len; ++i) {
+            out[i] = table[in[i]] ^ stream[i % KEY_SIZE];
+        }
+    }
+}
+
+
+#ifdef BATCH_X86
+/*
+ * Function:  encrypt_run_avx2
+ * --------------------
+ * This function encrypts a run of records that share one key,
+ * 32 bytes at a time with AVX2.
+ *
+ * pshufb can only look up 16 entries, so the 256-entry table is
+ * split into 16 rows by the high nibble of the byte. Each row is
+ * looked up with the low nibble and kept where the high nibble
+ * matches. The rows are loaded once for the whole run.
+ * --------------------
+ * records: array of all records in the batch
+ * start: index of the run's first record
+ * end: index one past the run's last record
+ */
+__attribute__((target("avx2")))
+static void encrypt_run_avx2(struct batch_record* records, int start, int end) {
+    struct key_context* ctx = records[start].ctx;
+    __m256i rows[CHAR_MAX / 16];
+    __m256i bias = _mm256_set1_epi8(0x70);
+    int r, h;
+
+    for(h = 0; h < CHAR_MAX / 16; ++h) {
+        rows[h] = _mm256_broadcastsi128_si256(_mm_loadu_si128((__m128i*)(ctx->subShift + 16 * h)));
+    }
+
+    for(r = start; r < end; ++r) {
+        unsigned char* in = records[r].in;
+        unsigned char* out = records[r].out;
+        long len = records[r].len;
+        __m256i stream = _mm256_loadu_si256((__m256i*)(ctx->keyStream + records[r].offset % KEY_SIZE));
+        unsigned char last[32];
+        long i = 0;
+
+        while(i < len) {
+            //Pad the last partial block through a local buffer
+            unsigned char* src = in + i;
+            long size = (len - i < 32) ? len - i : 32;
+            if(size < 32) {
+                memcpy(last, src, size);
+                src = last;
+            }
+
+            //Clearing the row number from the high nibble and adding
+            //0x70 with saturation leaves bit 7 clear only in bytes of
+            //that row, and pshufb gives 0 for bytes with bit 7 set
+            __m256i x = _mm256_loadu_si256((__m256i*)src);
+            __m256i y0 = _mm256_setzero_si256();
+            __m256i y1 = _mm256_setzero_si256();
+            for(h = 0; h < CHAR_MAX / 16; h += 2) {
+                __m256i index0 = _mm256_adds_epu8(_mm256_xor_si256(x, _mm256_set1_epi8((char)(h << 4))), bias);
+                __m256i index1 = _mm256_adds_epu8(_mm256_xor_si256(x, _mm256_set1_epi8((char)((h + 1) << 4))), bias);
+                y0 = _mm256_or_si256(y0, _mm256_shuffle_epi8(rows[h], index0));
+                y1 = _mm256_or_si256(y1, _mm256_shuffle_epi8(rows[h+1], index1));
+            }
+            __m256i y = _mm256_xor_si256(_mm256_or_si256(y0, y1), stream);
+
+            if(size < 32) {
+                _mm256_storeu_si256((__m256i*)last, y);
+                memcpy(out + i, last, size);
+            } else {
+                _mm256_storeu_si256((__m256i*)(out + i), y);
+            }
+            i += size;
+        }
+    }
+}
+
+
+/*
+ * Function:  encrypt_run_avx512
+ * --------------------
+ * This function encrypts a run of records that share one key,
+ * 64 bytes at a time with AVX-512 VBMI.
+ *
+ * vpermi2b looks up 128 entries from two registers, so two of
+ * them cover the whole 256-entry table and the top bit of the
+ * byte picks between them. The table is loaded once for the
+ * whole run and partial blocks use masked loads and stores.
+ * --------------------
+ * records: array of all records in the batch
+ * start: index of the run's first record
+ * end: index one past the run's last record
+ */
+__attribute__((target("avx512f,avx512bw,avx512vbmi")))
+static void encrypt_run_avx512(struct batch_record* records, int start, int end) {
+    struct key_context* ctx = records[start].ctx;
+    __m512i table0 = _mm512_loadu_si512(ctx->subShift);
+    __m512i table1 = _mm512_loadu_si512(ctx->subShift + 64);
+    __m512i table2 = _mm512_loadu_si512(ctx->subShift + 128);
+    __m512i table3 = _mm512_loadu_si512(ctx->subShift + 192);
+    int r;
+
+    for(r = start; r < end; ++r) {
+        unsigned char* in = records[r].in;
+        unsigned char* out = records[r].out;
+        long len = records[r].len;
+        __m512i stream = _mm512_loadu_si512(ctx->keyStream + records[r].offset % KEY_SIZE);
+        long i = 0;
+
+        while(i < len) {
+            long size = (len - i < 64) ? len - i : 64;
+            __mmask64 mask = (size < 64) ? (((__mmask64)1 << size) - 1) : ~(__mmask64)0;
+
+            __m512i x = _mm512_maskz_loadu_epi8(mask, in + i);
+            __m512i low = _mm512_permutex2var_epi8(table0, x, table1);
+            __m512i high = _mm512_permutex2var_epi8(table2, x, table3);
+            __m512i y = _mm512_mask_blend_epi8(_mm512_movepi8_mask(x), low, high);
+            y = _mm512_xor_si512(y, stream);
+
+            _mm512_mask_storeu_epi8(out + i, mask, y);
+            i += size;
+        }
+    }
+}
+#endif
+
+
+/*
+ * Function:  batch_path_supported
+ * --------------------
+ * This function checks whether the CPU running the program
+ * can use the given encrypt_batch code path.
+ * --------------------
+ * path: BATCH_SCALAR, BATCH_AVX2 or BATCH_AVX512
+ *
+ * returns: 1 -> supported, 0-> not supported
+ */
+int batch_path_supported(int path) {
+    if(path == BATCH_SCALAR) {
+        return 1;
+    }
+#ifdef BATCH_X86
+    __builtin_cpu_init();
+    if(path == BATCH_AVX2) {
+        return __builtin_cpu_supports("avx2") != 0;
+    }
+    if(path == BATCH_AVX512) {
+        return __builtin_cpu_supports("avx512f") && __builtin_cpu_supports("avx512bw") &&
+               __builtin_cpu_supports("avx512vbmi");
+    }
+#endif
+    return 0;
+}
+
+
+/*
+ * Function:  best_batch_path
+ * --------------------
+ * This function picks the fastest encrypt_batch code path the
+ * CPU supports. The result is worked out once and cached.
+ * --------------------
+ * returns: BATCH_AVX512, BATCH_AVX2 or BATCH_SCALAR
+ */
+int best_batch_path(void) {
+    static int best = -1;
+    if(best == -1) {
+        if(batch_path_supported(BATCH_AVX512)) {
+            best = BATCH_AVX512;
+        } else if(batch_path_supported(BATCH_AVX2)) {
+            best = BATCH_AVX2;
+        } else {
+            best = BATCH_SCALAR;
+        }
+    }
+    return best;
+}
+
+
+/*
+ * Function:  encrypt_batch
+ * --------------------
+ * This function encrypts many in-memory records in one call,
+ * using the fastest code path the CPU supports.
+ * It produces the same bytes as encrypt for the same key, so the
+ * output can be recovered with decrypt.
+ *
+ * Each record names its key context, input and output buffers,
+ * length and offset into the 32-byte keystream, so one file can
+ * be split into several records. The key contexts must have been
+ * set up with init_key_context.
+ * --------------------
+ * records: array of records to encrypt
+ * count: number of records
+ *
+ * returns: 0 -> function pass, 1-> function fail
+ */
+int encrypt_batch(struct batch_record* records, int count) {
+    return encrypt_batch_path(records, count, best_batch_path());
+}
+
+
+/*
+ * Function:  encrypt_batch_path
+ * --------------------
+ * This function is encrypt_batch with a fixed code path, so
+ * the paths can be tested and timed against each other.
+ *
+ * Records are taken in order, and consecutive records with the
+ * same key context form a run that is encrypted with the key's
+ * lookup tables held in registers. Callers get the most out of
+ * this by putting records with the same key next to each other.
+ * Records are not reordered by key, since jumping around the
+ * buffers costs more memory traffic than reloading the tables.
+ * --------------------
+ * records: array of records to encrypt
+ * count: number of records
+ * path: BATCH_SCALAR, BATCH_AVX2 or BATCH_AVX512
+ *
+ * returns: 0 -> function pass, 1-> function fail
+ */
+int encrypt_batch_path(struct batch_record* records, int count, int path) {
+    int r, start;
+
+    //Check all records before touching any output
+    for(r = 0; r < count; ++r) {
+        struct batch_record* rec = &records[r];
+        if(rec->ctx == NULL || rec->len < 0 || rec->offset < 0 ||
+           (rec->len > 0 && (rec->in == NULL || rec->out == NULL))) {
+            fprintf(stderr, "Invalid batch record %d.\n", r);
+            return 1;
+        }
+    }
+
+    if(!batch_path_supported(path)) {
+        fprintf(stderr, "Batch code path %d is not supported on this CPU.\n", path);
+        return 1;
+    }
+
+    //Encrypt each run of records that share a key
+    for(start = 0; start < count; start = r) {
+        r = start + 1;
+        while(r < count && records[r].ctx == records[start].ctx) {
+            ++r;
+        }
+#ifdef BATCH_X86
+        if(path == BATCH_AVX512) {
+            encrypt_run_avx512(records, start, r);
+            continue;
+        }
+        if(path == BATCH_AVX2) {
+            encrypt_run_avx2(records, start, r);
+            continue;
+        }
+#endif
+        encrypt_run_scalar(records, start, r);
+    }
+
+    return 0;
 }
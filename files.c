@@ -0,0 +1,82 @@
+#include "files.h"
+
+/*
+ * Function:  output_name
+ * --------------------
+ * This function builds the name of an output file by adding
+ * a suffix before the extension of the input file, following
+ * the naming convention inputFilename_suffix.extension
+ *
+ * Only a '.' in the last path component starts the extension.
+ * Names without an extension get the suffix appended at the end.
+ *
+ * The returned string is allocated on the heap and must be
+ * freed by the caller.
+ * --------------------
+ * filename: input file name
+ * suffix: suffix to add, e.g. "_ciphertext"
+ *
+ * returns: new file name, NULL on failure
+ */
+char* output_name(char* filename, char* suffix) {
+    size_t nameLength = strlen(filename);
+    size_t suffixLength = strlen(suffix);
+    size_t extensionIndex = nameLength;
+
+    char* outFile = (char*)malloc(sizeof(char) * (nameLength + suffixLength + 1));
+    if(outFile == NULL) {
+        fprintf(stderr, "malloc failed!\n");
+        return NULL;
+    }
+
+    //Find the extension, if any, in the last path component
+    char* extensionPos = strrchr(filename, '.');
+    char* slashPos = strrchr(filename, '/');
+    if(extensionPos != NULL && (slashPos == NULL || extensionPos > slashPos)) {
+        extensionIndex = extensionPos - filename;
+    }
+
+    memcpy(outFile, filename, extensionIndex);
+    memcpy(outFile+extensionIndex, suffix, suffixLength);
+    strcpy(outFile+extensionIndex+suffixLength, filename+extensionIndex);
+
+    return outFile;
+}
+
+
+/*
+ * Function:  open_input
+ * --------------------
+ * This function opens an input file for reading and finds
+ * its size. Empty files are rejected since there is nothing
+ * to encrypt or decrypt.
+ * --------------------
+ * filename: file to open
+ * fileSize: pointer to store the size of the file
+ *
+ * returns: open file pointer, NULL on failure
+ */
+FILE* open_input(char* filename, long* fileSize) {
+    FILE* fp;    //file pointer
+
+    fp = fopen(filename, "rb");
+    if(fp == NULL) {
+        fprintf(stderr, "File open failed. Check if %s exists!\n", filename);
+        return NULL;
+    }
+
+    //Get the size of the file
+    fseek(fp, 0, SEEK_END);
+    *fileSize = ftell(fp);
+    fseek(fp, 0, SEEK_SET);
+    printf("File size: %ld bytes\n", *fileSize);
+
+    if(*fileSize <= 0) {
+        fprintf(stderr, "Invalid file size. Atleast one byte needed!\n");
+        fclose(fp);
+        return NULL;
+    }
+
+    return fp;
+}
+
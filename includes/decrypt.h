@@ -2,11 +2,13 @@
 #include <stdlib.h>
 #include <string.h>
 
+#include "files.h"
+
 #define CHAR_MAX 256
 #define KEY_SIZE 32
-#define MAX_BUF_SIZE 209715200
 #define KEY_FILE_SIZE 290
 
 //Decryption functions
 int read_key(char* filename, unsigned char* invRandomSub, short* randomShift, unsigned char* key);
-void decrypt(char* ciphertext, char* cipherkey);
\ No newline at end of file
+void decrypt(char* ciphertext, char* cipherkey);
+void decrypt_to(char* ciphertext, char* cipherkey, char* outFile);
\ No newline at end of file
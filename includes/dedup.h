@@ -0,0 +1,15 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define HASH_BUF_SIZE 65536
+
+//Deduplication functions
+int hash_file(char* filename, unsigned char* digest, long* fileSize);
+char* open_store(char* storeDir);
+char* store_name(char* store, unsigned char* digest, char* suffix);
+int file_exists(char* filename);
+int store_file(char* store, char* inputFile, unsigned char* digest);
+int write_ref(char* inputFile, char* ciphertext, char* cipherkey);
+void encrypt_dedup(char* storeDir, char** inputFiles, int count);
+void decrypt_ref(char* refFile);
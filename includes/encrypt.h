@@ -2,16 +2,49 @@
 #include <stdlib.h>
 #include <time.h>
 #include <string.h>
+#include <stdint.h>
 
 #include "pcg_basic.h"
+#include "files.h"
+#include "sha256.h"
 
 #define CHAR_MAX 256
 #define CHAR_BITS 8
 #define KEY_SIZE 32
-#define MAX_BUF_SIZE 209715200
+
+//Key structures with stages 1 and 2 fused into one lookup table
+struct key_context {
+    unsigned char randomSub[CHAR_MAX];
+    short randomShift;
+    unsigned char key[KEY_SIZE];
+    unsigned char subShift[CHAR_MAX];
+    unsigned char keyStream[3 * KEY_SIZE];    //key repeated, read from any offset
+};
+
+//Code paths for encrypt_batch
+enum batch_path {
+    BATCH_SCALAR,
+    BATCH_AVX2,    //nibble-split pshufb lookup
+    BATCH_AVX512    //vpermi2b lookup, needs AVX-512 VBMI
+};
+
+//One record to encrypt in a batch
+struct batch_record {
+    struct key_context* ctx;    //key used for this record
+    unsigned char* in;    //plaintext bytes
+    unsigned char* out;    //ciphertext bytes (may be the same as in)
+    long len;    //number of bytes to encrypt
+    long offset;    //position of in[0] in the keystream
+};
 
 //Encryption functions
 void shuffle(unsigned char* array, int size);
 void generate_key(unsigned char* randomSub, short* randomShift, unsigned char* key);
-void write_key(char* filename, unsigned char* randomSub, short* randomShift, unsigned char* key);
-void encrypt(char* inputFile);
\ No newline at end of file
+int write_key(char* keyFile, unsigned char* randomSub, short* randomShift, unsigned char* key);
+int encrypt(char* inputFile);
+int encrypt_to(char* inputFile, char* outFile, char* keyFile, struct sha256_context* hash);
+void init_key_context(struct key_context* ctx);
+int batch_path_supported(int path);
+int best_batch_path(void);
+int encrypt_batch(struct batch_record* records, int count);
+int encrypt_batch_path(struct batch_record* records, int count, int path);
\ No newline at end of file
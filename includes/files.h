@@ -0,0 +1,14 @@
+#ifndef FILES_H_INCLUDED
+#define FILES_H_INCLUDED
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define MAX_BUF_SIZE 209715200
+
+//File naming and opening functions
+char* output_name(char* filename, char* suffix);
+FILE* open_input(char* filename, long* fileSize);
+
+#endif
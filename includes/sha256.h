@@ -0,0 +1,23 @@
+#ifndef SHA256_H_INCLUDED
+#define SHA256_H_INCLUDED
+
+#include <stddef.h>
+#include <inttypes.h>
+
+#define SHA256_SIZE 32
+#define SHA256_BLOCK_SIZE 64
+
+//Running state of a SHA-256 digest
+struct sha256_context {
+    uint32_t state[8];
+    uint64_t length;    //number of bytes hashed so far
+    unsigned char block[SHA256_BLOCK_SIZE];
+    size_t used;    //bytes waiting in block
+};
+
+//SHA-256 functions
+void sha256_init(struct sha256_context* ctx);
+void sha256_update(struct sha256_context* ctx, const unsigned char* data, size_t len);
+void sha256_final(struct sha256_context* ctx, unsigned char* digest);
+
+#endif
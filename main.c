@@ -1,11 +1,19 @@
 #include <stdio.h>
+#include <string.h>
 
 #include "includes/encrypt.h"
 #include "includes/decrypt.h"
+#include "includes/dedup.h"
 
 int main(int argc, char* argv[]) {
     //Check arguments supplied and call the corresponding functions
-    if(argc == 2) {
+    if(argc >= 4 && strcmp(argv[1], "-d") == 0) {
+        printf("Dedup Encryption Mode\n");
+        encrypt_dedup(argv[2], &argv[3], argc - 3);
+    } else if(argc == 3 && strcmp(argv[1], "-r") == 0) {
+        printf("Dedup Decryption Mode\n");
+        decrypt_ref(argv[2]);
+    } else if(argc == 2) {
         printf("Encryption Mode\n");
         encrypt(argv[1]);
     } else if(argc == 3) {
@@ -15,6 +23,8 @@ int main(int argc, char* argv[]) {
         printf("Invalid number of arguments\n");
         printf("Encryption Usage: ./program plaintext\n");
         printf("Decryption Usage: ./program ciphertext cipherkey\n");
+        printf("Dedup Encryption Usage: ./program -d dedupstore plaintext1 plaintext2 ...\n");
+        printf("Dedup Decryption Usage: ./program -r cipherref\n");
     }
     return 0;
 }
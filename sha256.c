@@ -0,0 +1,150 @@
+#include <string.h>
+
+#include "sha256.h"
+
+//Round constants (FIPS 180-4, section 4.2.2)
+static const uint32_t k[64] = {
+    0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+    0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+    0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+    0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+    0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+    0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+    0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+    0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2
+};
+
+#define ROTR(x, n) (((x) >> (n)) | ((x) << (32 - (n))))
+
+/*
+ * Function:  sha256_transform
+ * --------------------
+ * This function mixes one 64-byte block into the digest state.
+ * --------------------
+ * ctx: digest state
+ * data: 64-byte block
+ */
+static void sha256_transform(struct sha256_context* ctx, const unsigned char* data) {
+    uint32_t w[64];
+    uint32_t a, b, c, d, e, f, g, h, t1, t2;
+    int i;
+
+    for(i = 0; i < 16; ++i) {
+        w[i] = ((uint32_t)data[4*i] << 24) | ((uint32_t)data[4*i+1] << 16) |
+               ((uint32_t)data[4*i+2] << 8) | (uint32_t)data[4*i+3];
+    }
+    for(i = 16; i < 64; ++i) {
+        uint32_t s0 = ROTR(w[i-15], 7) ^ ROTR(w[i-15], 18) ^ (w[i-15] >> 3);
+        uint32_t s1 = ROTR(w[i-2], 17) ^ ROTR(w[i-2], 19) ^ (w[i-2] >> 10);
+        w[i] = w[i-16] + s0 + w[i-7] + s1;
+    }
+
+    a = ctx->state[0]; b = ctx->state[1]; c = ctx->state[2]; d = ctx->state[3];
+    e = ctx->state[4]; f = ctx->state[5]; g = ctx->state[6]; h = ctx->state[7];
+
+    for(i = 0; i < 64; ++i) {
+        t1 = h + (ROTR(e, 6) ^ ROTR(e, 11) ^ ROTR(e, 25)) + ((e & f) ^ (~e & g)) + k[i] + w[i];
+        t2 = (ROTR(a, 2) ^ ROTR(a, 13) ^ ROTR(a, 22)) + ((a & b) ^ (a & c) ^ (b & c));
+        h = g; g = f; f = e; e = d + t1;
+        d = c; c = b; b = a; a = t1 + t2;
+    }
+
+    ctx->state[0] += a; ctx->state[1] += b; ctx->state[2] += c; ctx->state[3] += d;
+    ctx->state[4] += e; ctx->state[5] += f; ctx->state[6] += g; ctx->state[7] += h;
+}
+
+
+/*
+ * Function:  sha256_init
+ * --------------------
+ * This function starts a new SHA-256 digest.
+ * --------------------
+ * ctx: digest state to initialise
+ */
+void sha256_init(struct sha256_context* ctx) {
+    ctx->state[0] = 0x6a09e667; ctx->state[1] = 0xbb67ae85;
+    ctx->state[2] = 0x3c6ef372; ctx->state[3] = 0xa54ff53a;
+    ctx->state[4] = 0x510e527f; ctx->state[5] = 0x9b05688c;
+    ctx->state[6] = 0x1f83d9ab; ctx->state[7] = 0x5be0cd19;
+    ctx->length = 0;
+    ctx->used = 0;
+}
+
+
+/*
+ * Function:  sha256_update
+ * --------------------
+ * This function adds bytes to a SHA-256 digest. It can be
+ * called any number of times with pieces of the message.
+ * --------------------
+ * ctx: digest state
+ * data: bytes to add
+ * len: number of bytes
+ */
+void sha256_update(struct sha256_context* ctx, const unsigned char* data, size_t len) {
+    ctx->length += len;
+
+    //Fill up a partial block first
+    if(ctx->used > 0) {
+        size_t take = SHA256_BLOCK_SIZE - ctx->used;
+        if(take > len) {
+            take = len;
+        }
+        memcpy(ctx->block + ctx->used, data, take);
+        ctx->used += take;
+        data += take;
+        len -= take;
+        if(ctx->used < SHA256_BLOCK_SIZE) {
+            return;
+        }
+        sha256_transform(ctx, ctx->block);
+        ctx->used = 0;
+    }
+
+    //Whole blocks straight from the input
+    while(len >= SHA256_BLOCK_SIZE) {
+        sha256_transform(ctx, data);
+        data += SHA256_BLOCK_SIZE;
+        len -= SHA256_BLOCK_SIZE;
+    }
+
+    //Keep the rest for the next call
+    memcpy(ctx->block, data, len);
+    ctx->used = len;
+}
+
+
+/*
+ * Function:  sha256_final
+ * --------------------
+ * This function pads the message and writes out the digest.
+ * --------------------
+ * ctx: digest state
+ * digest: pointer to store the 32-byte digest
+ */
+void sha256_final(struct sha256_context* ctx, unsigned char* digest) {
+    uint64_t bits = ctx->length * 8;
+    int i;
+
+    //Append the 1 bit and pad to 56 bytes mod 64
+    ctx->block[ctx->used++] = 0x80;
+    if(ctx->used > SHA256_BLOCK_SIZE - 8) {
+        memset(ctx->block + ctx->used, 0, SHA256_BLOCK_SIZE - ctx->used);
+        sha256_transform(ctx, ctx->block);
+        ctx->used = 0;
+    }
+    memset(ctx->block + ctx->used, 0, SHA256_BLOCK_SIZE - 8 - ctx->used);
+
+    //Append the message length in bits, big endian
+    for(i = 0; i < 8; ++i) {
+        ctx->block[SHA256_BLOCK_SIZE - 1 - i] = (unsigned char)(bits >> (8 * i));
+    }
+    sha256_transform(ctx, ctx->block);
+
+    for(i = 0; i < 8; ++i) {
+        digest[4*i] = (unsigned char)(ctx->state[i] >> 24);
+        digest[4*i+1] = (unsigned char)(ctx->state[i] >> 16);
+        digest[4*i+2] = (unsigned char)(ctx->state[i] >> 8);
+        digest[4*i+3] = (unsigned char)ctx->state[i];
+    }
+}